@@ -12,6 +12,7 @@
  */
 
 #include "net_util.h"
+#include "session_util.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,10 +25,24 @@
 #include <arpa/inet.h>
 
 #define COOKIE_PATH "./browser.cookie"
+#define MAX_PENDING_UPDATES 64
 
-static bool browser_on = true;  // Determines if the browser is on/off.
-static int server_socket_fd;    // The socket file descriptor of the server that is currently being connected.
-static int session_id;          // The session ID of the session on the server that is currently being accessed.
+typedef struct pending_update_struct {
+    int seq;
+    char message[BUFFER_LEN];
+} pending_update_t;
+
+static bool browser_on = true;          // Determines if the browser is on/off.
+static int server_socket_fd;            // The socket file descriptor of the server that is currently being connected.
+static int session_id;                  // The session ID of the session on the server that is currently being accessed.
+static session_t local_session;         // The local replica of the session, including optimistic updates.
+static session_t confirmed_session;     // The last session state confirmed by the server.
+static char displayed[BUFFER_LEN];      // The session string that is currently shown to the user.
+static pending_update_t pending_updates[MAX_PENDING_UPDATES];      // The user's updates the server has not answered yet.
+static int num_pending_updates = 0;     // The number of updates the server has not answered yet.
+static int last_sent_seq = 0;           // The sequence number of the user's last update.
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;  // A mutex lock for the local session replica.
+static pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;     // Keeps user input and heartbeats from interleaving.
 
 // Reads the user input from stdin.
 // If the input is "EXIT" or "exit",
@@ -43,12 +58,35 @@ void load_cookie();
 void save_cookie();
 
 // Interacts with the server to get or confirm
-// the final session ID.
+// the final session ID and the current state of the session.
 void register_server();
 
+// Prints the given session string unless it is already shown.
+void display_session(const char str[]);
+
+// Rebuilds the local replica from the confirmed state
+// and the updates the server has not answered yet.
+void rebuild_local_session();
+
+// Removes the pending updates with sequence numbers in the given range.
+void remove_pending_updates(int first_seq, int last_seq);
+
+// Applies the user's own update to the local replica optimistically
+// and shows the result right away.
+void apply_local_update(const char message[]);
+
+// Reconciles the local replica with the message received from the server.
+// Adopts the authoritative state, or drops a rejected update.
+void reconcile_session(const char message[]);
+
 // Listens to the server.
-// Keeps receiving and printing the messages from the server.
-void server_listener();
+// Keeps receiving the messages from the server
+// and reconciling the local replica with them.
+void *server_listener(void *arg);
+
+// Sends a heartbeat to the server every HEARTBEAT_INTERVAL seconds
+// so that an idle user is not disconnected.
+void *heartbeat_sender(void *arg);
 
 // Starts the browser.
 // Sets up the connection, start the listener thread,
@@ -93,6 +131,8 @@ void save_cookie() {
 
 /**
  * Interacts with the server to get or confirm the final session ID.
+ * The server follows the session ID with the current state of the session,
+ * which becomes the confirmed state of the replica.
  */
 void register_server() {
     char message[BUFFER_LEN];
@@ -101,25 +141,167 @@ void register_server() {
 
     receive_message(server_socket_fd, message);
     session_id = strtol(message, NULL, 10);
+
+    // Starts from the current state of the session.
+    int ack;
+    receive_message(server_socket_fd, message);
+    message_to_session(message, &ack, &confirmed_session);
 }
 
 /**
- * Listens to the server; keeps receiving and printing the messages from the server.
+ * Prints the given session string unless it is already shown.
+ * Must be called with session_mutex held.
+ *
+ * @param str the string format of the session
  */
-void server_listener() {
-    // TODO: For Part 2.3, uncomment the loop code that was commented out
-    //  when you are done with multithreading.
+void display_session(const char str[]) {
+    if (strcmp(str, displayed) == 0) {
+        return;
+    }
 
-    // while (browser_on) {
+    strcpy(displayed, str);
+    puts(displayed);
+}
 
-    char message[BUFFER_LEN];
-    receive_message(server_socket_fd, message);
+/**
+ * Rebuilds the local replica from the confirmed state by applying the updates
+ * the server has not answered yet, in the order they were sent, and shows the
+ * result. Must be called with session_mutex held.
+ */
+void rebuild_local_session() {
+    char result[BUFFER_LEN];
+
+    local_session = confirmed_session;
+    for (int i = 0; i < num_pending_updates; ++i) {
+        process_message(&local_session, pending_updates[i].message);
+    }
 
-    // TODO: For Part 3.1, add code here to print the error message.
+    session_to_str(&local_session, result);
+    display_session(result);
+}
 
-    puts(message);
+/**
+ * Removes the pending updates with sequence numbers in the given range.
+ * Must be called with session_mutex held.
+ *
+ * @param first_seq the first sequence number to remove
+ * @param last_seq the last sequence number to remove
+ */
+void remove_pending_updates(int first_seq, int last_seq) {
+    int kept = 0;
 
-    //}
+    for (int i = 0; i < num_pending_updates; ++i) {
+        if (pending_updates[i].seq < first_seq || pending_updates[i].seq > last_seq) {
+            pending_updates[kept++] = pending_updates[i];
+        }
+    }
+
+    num_pending_updates = kept;
+}
+
+/**
+ * Applies the user's own update to the local replica optimistically and shows
+ * the result right away. The update stays pending until the server accepts or
+ * rejects it. The server numbers the updates of each browser the same way.
+ *
+ * @param message the message typed by the user
+ */
+void apply_local_update(const char message[]) {
+    pthread_mutex_lock(&session_mutex);
+
+    last_sent_seq++;
+    if (num_pending_updates < MAX_PENDING_UPDATES) {
+        pending_updates[num_pending_updates].seq = last_sent_seq;
+        strcpy(pending_updates[num_pending_updates].message, message);
+        num_pending_updates++;
+
+        if (process_message(&local_session, message)) {
+            char result[BUFFER_LEN];
+            session_to_str(&local_session, result);
+            display_session(result);
+        }
+    }
+
+    pthread_mutex_unlock(&session_mutex);
+}
+
+/**
+ * Reconciles the local replica with the message received from the server.
+ * A session state becomes the new confirmed state, and the update it
+ * acknowledges is no longer pending. A rejection, including a rate-limited or
+ * busy response, drops only the rejected update. The remaining pending updates
+ * are then applied again on top of the confirmed state.
+ *
+ * @param message the message received from the server
+ */
+void reconcile_session(const char message[]) {
+    int seq;
+    char reason[BUFFER_LEN];
+
+    pthread_mutex_lock(&session_mutex);
+
+    if (message_to_session(message, &seq, &confirmed_session)) {
+        // The server serves the updates of a browser in order.
+        remove_pending_updates(1, seq);
+        rebuild_local_session();
+    } else if (message_to_rejection(message, &seq, reason)) {
+        puts(reason);
+        remove_pending_updates(seq, seq);
+        rebuild_local_session();
+    } else {
+        puts(message);
+    }
+
+    pthread_mutex_unlock(&session_mutex);
+}
+
+/**
+ * Listens to the server; keeps receiving the messages from the server and
+ * reconciling the local replica with them.
+ *
+ * @param arg unused
+ * @return always NULL
+ */
+void *server_listener(void *arg) {
+    (void) arg;
+
+    while (browser_on) {
+        char message[BUFFER_LEN];
+        if (receive_message(server_socket_fd, message) <= 0) {
+            if (browser_on) {
+                puts("Lost the connection to the server.");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+
+        reconcile_session(message);
+    }
+
+    return NULL;
+}
+
+/**
+ * Sends a heartbeat to the server every HEARTBEAT_INTERVAL seconds so that an
+ * idle user is not disconnected. The server does not reply to heartbeats.
+ *
+ * @param arg unused
+ * @return always NULL
+ */
+void *heartbeat_sender(void *arg) {
+    (void) arg;
+
+    while (browser_on) {
+        sleep(HEARTBEAT_INTERVAL);
+
+        pthread_mutex_lock(&send_mutex);
+        if (browser_on) {
+            send_message(server_socket_fd, HEARTBEAT_MESSAGE);
+        }
+        pthread_mutex_unlock(&send_mutex);
+    }
+
+    return NULL;
 }
 
 /**
@@ -156,20 +338,41 @@ void start_browser(const char host_ip[], int port) {
     register_server();
     printf("Running Session #%d:\n", session_id);
 
+    // Shows the current state of the session.
+    pthread_mutex_lock(&session_mutex);
+    rebuild_local_session();
+    pthread_mutex_unlock(&session_mutex);
+
     // Saves the session ID to the cookie on the disk.
     save_cookie();
 
+    // Starts the heartbeat thread.
+    pthread_t heartbeat;
+    if (pthread_create(&heartbeat, NULL, heartbeat_sender, NULL) != 0) {
+        perror("Heartbeat creation failed");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(heartbeat);
+
+    // Starts the listener thread.
+    pthread_t listener;
+    if (pthread_create(&listener, NULL, server_listener, NULL) != 0) {
+        perror("Listener creation failed");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(listener);
+
     // Main loop to read in the user's input and send it out.
+    // The server ignores empty messages and heartbeats, so they get no sequence number.
     while (browser_on) {
         char message[BUFFER_LEN];
         read_user_input(message);
+        if (browser_on && message[0] != '\0' && strcmp(message, HEARTBEAT_MESSAGE) != 0) {
+            apply_local_update(message);
+        }
+        pthread_mutex_lock(&send_mutex);
         send_message(server_socket_fd, message);
-
-        // Starts the listener thread.
-        // TODO: For Part 2.3, move server_listener() out of the loop and
-        //  creat a thread to run it.
-        // Hint: Should we place server_listener() before or after the loop?
-        server_listener();
+        pthread_mutex_unlock(&send_mutex);
     }
 
     // Closes the socket.
@@ -18,13 +18,16 @@
 
 /**
  * Sends the message through socket.
+ * The message is padded to BUFFER_LEN, so it may be shorter than that.
  *
  * @param socket_fd the socket id used to send the message
  * @param message the message to send
  * @return the number of characters sent
  */
 ssize_t send_message(int socket_fd, const char message[]) {
-    return send(socket_fd, message, BUFFER_LEN, 0);
+    char buffer[BUFFER_LEN] = {0};
+    strncpy(buffer, message, BUFFER_LEN - 1);
+    return send(socket_fd, buffer, BUFFER_LEN, 0);
 }
 
 /**
@@ -19,6 +19,11 @@
 #define DEFAULT_HOST_IP "127.0.0.1"
 #define DEFAULT_PORT 7000
 #define BUFFER_LEN 1024
+#define INVALID_MESSAGE "Invalid input!"
+#define RATE_LIMITED_MESSAGE "Too many requests!"
+#define SERVER_BUSY_MESSAGE "Server busy!"
+#define HEARTBEAT_MESSAGE "HEARTBEAT"
+#define HEARTBEAT_INTERVAL 10  // Seconds between heartbeats sent by the browser.
 
 // Sends the message through socket.
 ssize_t send_message(int socket_fd, const char message[]);
@@ -11,55 +11,117 @@
  ***************************************************************************
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "net_util.h"
+#include "session_util.h"
+#include "trace.h"
+#include "timer_wheel.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <ctype.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 
-#define NUM_VARIABLES 26
 #define NUM_SESSIONS 128
 #define NUM_BROWSER 128
 #define DATA_DIR "./sessions"
 #define SESSION_PATH_LEN 128
+#define NUM_WORKERS 4               // Number of worker threads serving the session queues.
+#define SESSION_QUEUE_LEN 32        // Maximum number of pending updates per session.
+#define MAX_PENDING_UPDATES 256     // Global queue depth beyond which the server reports busy.
+#define SCHEDULER_QUANTUM 4         // Maximum number of updates served per session per turn.
+#define RATE_LIMIT 20.0             // Tokens added to each browser's bucket per second.
+#define RATE_BURST 40.0             // Capacity of each browser's token bucket.
+#define TIMER_TICK_MS 100           // Resolution of the connection timers.
+#define HANDSHAKE_TIMEOUT_MS 5000   // Time a new browser has to send its session ID.
+#define IDLE_TIMEOUT_MS 30000       // Time a browser may stay silent, heartbeats included.
+#define SEND_TIMEOUT_MS 1000        // Time a send may block before the browser is dropped.
 
 typedef struct browser_struct {
     bool in_use;
+    unsigned int generation;
     int socket_fd;
     int session_id;
+    double tokens;
+    struct timespec last_refill;
+    wheel_timer_t timer;
+    pthread_mutex_t send_mutex;
 } browser_t;
 
-typedef struct session_struct {
-    bool in_use;
-    bool variables[NUM_VARIABLES];
-    double values[NUM_VARIABLES];
-} session_t;
+typedef struct update_struct {
+    int browser_id;
+    unsigned int generation;
+    int seq;
+    uint64_t request_id;
+    char message[BUFFER_LEN];
+} update_t;
+
+typedef struct session_queue_struct {
+    bool scheduled;
+    int head;
+    int count;
+    update_t updates[SESSION_QUEUE_LEN];
+} session_queue_t;
 
 static browser_t browser_list[NUM_BROWSER];                             // Stores the information of all browsers.
 // TODO: For Part 3.2, convert the session_list to a simple hashmap/dictionary.
 static session_t session_list[NUM_SESSIONS];                            // Stores the information of all sessions.
 static pthread_mutex_t browser_list_mutex = PTHREAD_MUTEX_INITIALIZER;  // A mutex lock for the browser list.
 static pthread_mutex_t session_list_mutex = PTHREAD_MUTEX_INITIALIZER;  // A mutex lock for the session list.
+static pthread_mutex_t session_mutex[NUM_SESSIONS];                     // Mutex locks for the state of each session.
+static session_queue_t session_queues[NUM_SESSIONS];                   // Stores the pending updates of all sessions.
+static int run_queue[NUM_SESSIONS];                                     // Sessions with pending updates, in serving order.
+static int run_queue_head = 0;                                          // The index of the next session to serve.
+static int run_queue_count = 0;                                         // The number of sessions waiting to be served.
+static int pending_updates = 0;                                         // The number of updates queued across all sessions.
+static pthread_mutex_t scheduler_mutex = PTHREAD_MUTEX_INITIALIZER;     // A mutex lock for the scheduler.
+static pthread_cond_t scheduler_cond = PTHREAD_COND_INITIALIZER;        // Signals workers that a session is ready.
+static timer_wheel_t timer_wheel;                                       // Drives the handshake and idle timeouts.
+static pthread_mutex_t timer_wheel_mutex = PTHREAD_MUTEX_INITIALIZER;   // A mutex lock for the timer wheel.
 
-// Returns the string format of the given session.
-// There will be always 9 digits in the output string.
-void session_to_str(int session_id, char result[]);
+// Broadcasts the given message to all browsers with the same session ID.
+// The browser that sent the update gets the given origin message instead.
+void broadcast(int session_id, int origin_id, unsigned int origin_generation,
+               const char message[], const char origin_message[]);
 
-// Determines if the given string represents a number.
-bool is_str_numeric(const char str[]);
+// Sends the given message to the given browser if it is still connected.
+void send_to_browser(int browser_id, unsigned int generation, int session_id, const char message[]);
 
-// Process the given message and update the given session if it is valid.
-bool process_message(int session_id, const char message[]);
+// Takes a token from the given browser's token bucket.
+// Returns false if the browser is over its rate limit.
+bool take_token(int browser_id);
 
-// Broadcasts the given message to all browsers with the same session ID.
-void broadcast(int session_id, const char message[]);
+// Puts the given update in its session's queue
+// and schedules the session if it is not scheduled yet.
+// Returns false if the server is too busy to accept it.
+bool enqueue_update(int session_id, const update_t *update);
+
+// Processes the given update, broadcasts the result,
+// and backs up the session on the disk.
+void serve_update(int session_id, const update_t *update);
+
+// Serves the scheduled sessions round-robin,
+// a few updates per session per turn.
+void *worker_thread(void *arg);
+
+// Disconnects the given browser when its timer expires.
+void expire_browser(void *arg);
+
+// Restarts the timer of the given browser with the given timeout.
+void arm_timer(int browser_id, int timeout_ms);
+
+// Advances the timer wheel in real time.
+void *timer_thread(void *arg);
 
 // Gets the path for the given session.
 void get_session_file_path(int session_id, char path[]);
@@ -75,12 +137,17 @@ void save_session(int session_id);
 // through the interaction with it.
 int register_browser(int browser_socket_fd);
 
-// Handles the given browser by listening to it,
-// processing the message received,
-// broadcasting the update to all browsers with the same session ID,
-// and backing up the session on the disk.
+// Stops the timer of the given browser, frees its slot,
+// and closes its socket.
+void release_browser(int browser_id);
+
+// Handles the given browser by listening to it
+// and queueing the messages received for the workers.
 void browser_handler(int browser_socket_fd);
 
+// Runs browser_handler() on its own thread.
+void *browser_thread(void *arg);
+
 // Starts the server.
 // Sets up the connection,
 // keeps accepting new browsers,
@@ -88,144 +155,288 @@ void browser_handler(int browser_socket_fd);
 void start_server(int port);
 
 /**
- * Returns the string format of the given session.
- * There will be always 9 digits in the output string.
+ * Broadcasts the given message to all browsers with the same session ID.
+ * The recipients are collected under browser_list_mutex, but each send only
+ * holds the recipient's own send lock, so a slow browser delays nobody else.
  *
  * @param session_id the session ID
- * @param result an array to store the string format of the given session;
- *               any data already in the array will be erased
+ * @param origin_id the ID of the browser that sent the update
+ * @param origin_generation the connection of the browser that sent the update
+ * @param message the message to be broadcasted
+ * @param origin_message the message sent to the browser that sent the update
  */
-void session_to_str(int session_id, char result[]) {
-    memset(result, 0, BUFFER_LEN);
-    session_t session = session_list[session_id];
-
-    for (int i = 0; i < NUM_VARIABLES; ++i) {
-        if (session.variables[i]) {
-            char line[32];
-
-            if (session.values[i] < 1000) {
-                sprintf(line, "%c = %.6f\n", 'a' + i, session.values[i]);
-            } else {
-                sprintf(line, "%c = %.8e\n", 'a' + i, session.values[i]);
-            }
+void broadcast(int session_id, int origin_id, unsigned int origin_generation,
+               const char message[], const char origin_message[]) {
+    int recipients[NUM_BROWSER];
+    unsigned int generations[NUM_BROWSER];
+    int num_recipients = 0;
 
-            strcat(result, line);
+    pthread_mutex_lock(&browser_list_mutex);
+    for (int i = 0; i < NUM_BROWSER; ++i) {
+        if (browser_list[i].in_use && browser_list[i].session_id == session_id) {
+            recipients[num_recipients] = i;
+            generations[num_recipients] = browser_list[i].generation;
+            num_recipients++;
         }
     }
+    pthread_mutex_unlock(&browser_list_mutex);
+
+    for (int i = 0; i < num_recipients; ++i) {
+        int browser_id = recipients[i];
+        bool is_origin = browser_id == origin_id && generations[i] == origin_generation;
+        trace_record(TRACE_SEND, TRACE_BEGIN, session_id, browser_id);
+        send_to_browser(browser_id, generations[i], session_id, is_origin ? origin_message : message);
+        trace_record(TRACE_SEND, TRACE_END, session_id, browser_id);
+    }
 }
 
 /**
- * Determines if the given string represents a number.
+ * Sends the given message to the given browser if it is still the same
+ * connection and still belongs to the given session. A slot is reused once its
+ * browser is released, so the generation tells a reconnected browser apart
+ * from the one that an update or a broadcast was meant for. Sends to a browser are serialized by its own send lock so that
+ * messages never interleave, and a browser cannot be released in the middle of
+ * a send. A browser whose send fails or times out is shut down; its handler
+ * then releases it. A send that timed out may have written part of the
+ * message, which breaks the fixed-length framing, so anything short of
+ * BUFFER_LEN counts as a failure.
  *
- * @param str the string to determine if it represents a number
- * @return a boolean that determines if the given string represents a number
+ * @param browser_id the browser ID
+ * @param generation the generation of the slot that the message is meant for
+ * @param session_id the session ID that the browser must still belong to
+ * @param message the message to send
  */
-bool is_str_numeric(const char str[]) {
-    if (str == NULL) {
-        return false;
+void send_to_browser(int browser_id, unsigned int generation, int session_id, const char message[]) {
+    browser_t *browser = &browser_list[browser_id];
+
+    pthread_mutex_lock(&browser->send_mutex);
+    if (browser->generation == generation && browser->session_id == session_id
+        && send_message(browser->socket_fd, message) != BUFFER_LEN) {
+        shutdown(browser->socket_fd, SHUT_RDWR);
     }
+    pthread_mutex_unlock(&browser->send_mutex);
+}
 
-    if (!(isdigit(str[0]) || (str[0] == '-') || (str[0] == '.'))) {
-        return false;
+/**
+ * Takes a token from the given browser's token bucket. The bucket refills at
+ * RATE_LIMIT tokens per second up to RATE_BURST tokens. Only the browser's own
+ * handler thread touches its bucket.
+ *
+ * @param browser_id the browser ID
+ * @return a boolean that determines if the browser is within its rate limit
+ */
+bool take_token(int browser_id) {
+    browser_t *browser = &browser_list[browser_id];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double elapsed = (double) (now.tv_sec - browser->last_refill.tv_sec)
+                     + (double) (now.tv_nsec - browser->last_refill.tv_nsec) / 1e9;
+    browser->last_refill = now;
+
+    browser->tokens += elapsed * RATE_LIMIT;
+    if (browser->tokens > RATE_BURST) {
+        browser->tokens = RATE_BURST;
     }
 
-    int i = 1;
-    while (str[i] != '\0') {
-        if (!(isdigit(str[i]) || str[i] == '.')) {
-            return false;
-        }
-        i++;
+    if (browser->tokens < 1.0) {
+        return false;
     }
 
+    browser->tokens -= 1.0;
     return true;
 }
 
 /**
- * Process the given message and update the given session if it is valid.
+ * Puts the given update in its session's queue and schedules the session if it
+ * is not scheduled yet. A session is in the run queue at most once, so every
+ * session with pending updates gets its turn regardless of how many it has.
  *
  * @param session_id the session ID
- * @param message the message to be processed
- * @return a boolean that determines if the given message is valid
+ * @param update the update to queue
+ * @return a boolean that determines if the update was accepted
  */
-bool process_message(int session_id, const char message[]) {
-    char *token;
-    int result_idx;
-    double first_value;
-    char symbol;
-    double second_value;
-
-    // TODO: For Part 3.1, write code to determine if the input is invalid and return false if it is.
-    // Hint: Also need to check if the given variable does exist (i.e., it has been assigned with some value)
-    // for the first variable and the second variable, respectively.
-
-    // Makes a copy of the string since strtok() will modify the string that it is processing.
-    char data[BUFFER_LEN];
-    strcpy(data, message);
-
-    // Processes the result variable.
-    token = strtok(data, " ");
-    result_idx = token[0] - 'a';
-
-    // Processes "=".
-    token = strtok(NULL, " ");
-
-    // Processes the first variable/value.
-    token = strtok(NULL, " ");
-    if (is_str_numeric(token)) {
-        first_value = strtod(token, NULL);
-    } else {
-        int first_idx = token[0] - 'a';
-        first_value = session_list[session_id].values[first_idx];
+bool enqueue_update(int session_id, const update_t *update) {
+    session_queue_t *queue = &session_queues[session_id];
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    if (pending_updates >= MAX_PENDING_UPDATES || queue->count == SESSION_QUEUE_LEN) {
+        pthread_mutex_unlock(&scheduler_mutex);
+        return false;
     }
 
-    // Processes the operation symbol.
-    token = strtok(NULL, " ");
-    if (token == NULL) {
-        session_list[session_id].variables[result_idx] = true;
-        session_list[session_id].values[result_idx] = first_value;
-        return true;
+    queue->updates[(queue->head + queue->count) % SESSION_QUEUE_LEN] = *update;
+    queue->count++;
+    pending_updates++;
+    trace_record(TRACE_QUEUE, TRACE_BEGIN, session_id, update->browser_id);
+
+    if (!queue->scheduled) {
+        queue->scheduled = true;
+        run_queue[(run_queue_head + run_queue_count) % NUM_SESSIONS] = session_id;
+        run_queue_count++;
+        pthread_cond_signal(&scheduler_cond);
     }
-    symbol = token[0];
 
-    // Processes the second variable/value.
-    token = strtok(NULL, " ");
-    if (is_str_numeric(token)) {
-        second_value = strtod(token, NULL);
-    } else {
-        int second_idx = token[0] - 'a';
-        second_value = session_list[session_id].values[second_idx];
+    pthread_mutex_unlock(&scheduler_mutex);
+    return true;
+}
+
+/**
+ * Processes the given update, broadcasts the result to all browsers with the
+ * same session ID, and backs up the session on the disk. The browser that sent
+ * the update gets a copy that acknowledges it, or a rejection if it is invalid.
+ * The session lock is held until the result is sent, so a browser joining the
+ * session either gets the state before the update and then the broadcast, or
+ * the state after it.
+ *
+ * @param session_id the session ID
+ * @param update the update to serve
+ */
+void serve_update(int session_id, const update_t *update) {
+    char response[BUFFER_LEN];
+    char origin_response[BUFFER_LEN];
+    int browser_id = update->browser_id;
+
+    pthread_mutex_lock(&session_mutex[session_id]);
+    trace_record(TRACE_PROCESS, TRACE_BEGIN, session_id, browser_id);
+    bool data_valid = process_message(&session_list[session_id], update->message);
+    trace_record(TRACE_PROCESS, TRACE_END, session_id, browser_id);
+    if (!data_valid) {
+        rejection_to_message(update->seq, INVALID_MESSAGE, response);
+        trace_record(TRACE_SEND, TRACE_BEGIN, session_id, browser_id);
+        send_to_browser(browser_id, update->generation, session_id, response);
+        trace_record(TRACE_SEND, TRACE_END, session_id, browser_id);
+        pthread_mutex_unlock(&session_mutex[session_id]);
+        return;
     }
 
-    // No data should be left over thereafter.
-    token = strtok(NULL, " ");
+    trace_record(TRACE_SESSION_TO_MESSAGE, TRACE_BEGIN, session_id, browser_id);
+    session_to_message(&session_list[session_id], 0, response);
+    session_to_message(&session_list[session_id], update->seq, origin_response);
+    trace_record(TRACE_SESSION_TO_MESSAGE, TRACE_END, session_id, browser_id);
 
-    session_list[session_id].variables[result_idx] = true;
+    broadcast(session_id, browser_id, update->generation, response, origin_response);
+    pthread_mutex_unlock(&session_mutex[session_id]);
 
-    if (symbol == '+') {
-        session_list[session_id].values[result_idx] = first_value + second_value;
-    } else if (symbol == '-') {
-        session_list[session_id].values[result_idx] = first_value - second_value;
-    } else if (symbol == '*') {
-        session_list[session_id].values[result_idx] = first_value * second_value;
-    } else if (symbol == '/') {
-        session_list[session_id].values[result_idx] = first_value / second_value;
+    trace_record(TRACE_SAVE, TRACE_BEGIN, session_id, browser_id);
+    save_session(session_id);
+    trace_record(TRACE_SAVE, TRACE_END, session_id, browser_id);
+}
+
+/**
+ * Serves the scheduled sessions round-robin. Each turn takes at most
+ * SCHEDULER_QUANTUM updates from one session and puts the session back at the
+ * end of the run queue if it still has updates. A scheduled session is owned by
+ * a single worker, so the updates of a session are served in order.
+ *
+ * @param arg unused
+ * @return never returns
+ */
+void *worker_thread(void *arg) {
+    (void) arg;
+
+    while (true) {
+        pthread_mutex_lock(&scheduler_mutex);
+        while (run_queue_count == 0) {
+            pthread_cond_wait(&scheduler_cond, &scheduler_mutex);
+        }
+        int session_id = run_queue[run_queue_head];
+        run_queue_head = (run_queue_head + 1) % NUM_SESSIONS;
+        run_queue_count--;
+        pthread_mutex_unlock(&scheduler_mutex);
+
+        session_queue_t *queue = &session_queues[session_id];
+        for (int served = 0; served < SCHEDULER_QUANTUM; ++served) {
+            update_t update;
+
+            pthread_mutex_lock(&scheduler_mutex);
+            if (queue->count == 0) {
+                pthread_mutex_unlock(&scheduler_mutex);
+                break;
+            }
+            update = queue->updates[queue->head];
+            queue->head = (queue->head + 1) % SESSION_QUEUE_LEN;
+            queue->count--;
+            pending_updates--;
+            trace_set_request(update.request_id);
+            trace_record(TRACE_QUEUE, TRACE_END, session_id, update.browser_id);
+            pthread_mutex_unlock(&scheduler_mutex);
+
+            serve_update(session_id, &update);
+        }
+
+        pthread_mutex_lock(&scheduler_mutex);
+        if (queue->count > 0) {
+            run_queue[(run_queue_head + run_queue_count) % NUM_SESSIONS] = session_id;
+            run_queue_count++;
+            pthread_cond_signal(&scheduler_cond);
+        } else {
+            queue->scheduled = false;
+        }
+        pthread_mutex_unlock(&scheduler_mutex);
     }
 
-    return true;
+    return NULL;
 }
 
 /**
- * Broadcasts the given message to all browsers with the same session ID.
+ * Disconnects the given browser when its timer expires. Shutting the socket
+ * down wakes the handler from receive_message(), which then releases the
+ * browser. Runs on the timer thread with timer_wheel_mutex held.
  *
- * @param session_id the session ID
- * @param message the message to be broadcasted
+ * @param arg the browser ID
  */
-void broadcast(int session_id, const char message[]) {
-    for (int i = 0; i < NUM_BROWSER; ++i) {
-        if (browser_list[i].in_use && browser_list[i].session_id == session_id) {
-            send_message(browser_list[i].socket_fd, message);
+void expire_browser(void *arg) {
+    int browser_id = (int) (intptr_t) arg;
+
+    printf("Browser #%d timed out.\n", browser_id);
+    shutdown(browser_list[browser_id].socket_fd, SHUT_RDWR);
+}
+
+/**
+ * Restarts the timer of the given browser with the given timeout. Both
+ * cancelling and adding are O(1), so this is cheap enough for every message.
+ *
+ * @param browser_id the browser ID
+ * @param timeout_ms the timeout in milliseconds
+ */
+void arm_timer(int browser_id, int timeout_ms) {
+    pthread_mutex_lock(&timer_wheel_mutex);
+    timer_wheel_cancel(&browser_list[browser_id].timer);
+    timer_wheel_add(&timer_wheel, &browser_list[browser_id].timer, timeout_ms / TIMER_TICK_MS);
+    pthread_mutex_unlock(&timer_wheel_mutex);
+}
+
+/**
+ * Advances the timer wheel in real time, one tick every TIMER_TICK_MS.
+ * Catches up on missed ticks if the thread was delayed.
+ *
+ * @param arg unused
+ * @return never returns
+ */
+void *timer_thread(void *arg) {
+    (void) arg;
+    struct timespec interval = {0, TIMER_TICK_MS * 1000000L};
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (true) {
+        nanosleep(&interval, NULL);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t elapsed_ms = (uint64_t) (now.tv_sec - start.tv_sec) * 1000
+                              + (uint64_t) ((now.tv_nsec - start.tv_nsec) / 1000000);
+
+        pthread_mutex_lock(&timer_wheel_mutex);
+        while (timer_wheel.now < elapsed_ms / TIMER_TICK_MS) {
+            timer_wheel_advance(&timer_wheel);
         }
+        pthread_mutex_unlock(&timer_wheel_mutex);
     }
+
+    return NULL;
 }
 
 /**
@@ -261,29 +472,47 @@ void save_session(int session_id) {
  * Assigns a browser ID to the new browser.
  * Determines the correct session ID for the new browser through the interaction with it.
  *
+ * The browser has HANDSHAKE_TIMEOUT_MS to send its session ID. The session ID
+ * is only published after the reply is sent, so no broadcast can overtake it.
+ * The reply is followed by the current state of the session, taken under the
+ * session lock so that no update is served between the snapshot and the
+ * browser joining the broadcasts.
+ *
  * @param browser_socket_fd the socket file descriptor of the browser connected
- * @return the ID for the browser
+ * @return the ID for the browser, or -1 if the browser could not be registered
  */
 int register_browser(int browser_socket_fd) {
-    int browser_id;
-
-    // TODO: For Part 2.2, identify the critical sections where different threads may read from/write to
-    //  the same shared static array browser_list and session_list. Place the lock and unlock
-    //  code around the critical sections identified.
+    int browser_id = -1;
 
+    pthread_mutex_lock(&browser_list_mutex);
     for (int i = 0; i < NUM_BROWSER; ++i) {
         if (!browser_list[i].in_use) {
             browser_id = i;
             browser_list[browser_id].in_use = true;
             browser_list[browser_id].socket_fd = browser_socket_fd;
+            browser_list[browser_id].tokens = RATE_BURST;
+            clock_gettime(CLOCK_MONOTONIC, &browser_list[browser_id].last_refill);
+            timer_init(&browser_list[browser_id].timer, expire_browser, (void *) (intptr_t) browser_id);
             break;
         }
     }
+    pthread_mutex_unlock(&browser_list_mutex);
+
+    if (browser_id == -1) {
+        close(browser_socket_fd);
+        return -1;
+    }
+
+    arm_timer(browser_id, HANDSHAKE_TIMEOUT_MS);
 
     char message[BUFFER_LEN];
-    receive_message(browser_socket_fd, message);
+    if (receive_message(browser_socket_fd, message) <= 0) {
+        release_browser(browser_id);
+        return -1;
+    }
 
     int session_id = strtol(message, NULL, 10);
+    pthread_mutex_lock(&session_list_mutex);
     if (session_id == -1) {
         for (int i = 0; i < NUM_SESSIONS; ++i) {
             if (!session_list[i].in_use) {
@@ -292,19 +521,76 @@ int register_browser(int browser_socket_fd) {
                 break;
             }
         }
+    } else if (session_id >= 0 && session_id < NUM_SESSIONS) {
+        session_list[session_id].in_use = true;
+    }
+    pthread_mutex_unlock(&session_list_mutex);
+
+    // Rejects a session ID out of range, including -1 when every session is in use.
+    if (session_id < 0 || session_id >= NUM_SESSIONS) {
+        release_browser(browser_id);
+        return -1;
     }
-    browser_list[browser_id].session_id = session_id;
 
+    pthread_mutex_lock(&session_mutex[session_id]);
+    pthread_mutex_lock(&browser_list[browser_id].send_mutex);
     sprintf(message, "%d", session_id);
-    send_message(browser_socket_fd, message);
+    bool sent = send_message(browser_socket_fd, message) == BUFFER_LEN;
+    if (sent) {
+        session_to_message(&session_list[session_id], 0, message);
+        sent = send_message(browser_socket_fd, message) == BUFFER_LEN;
+    }
+    if (!sent) {
+        pthread_mutex_unlock(&browser_list[browser_id].send_mutex);
+        pthread_mutex_unlock(&session_mutex[session_id]);
+        release_browser(browser_id);
+        return -1;
+    }
+
+    pthread_mutex_lock(&browser_list_mutex);
+    browser_list[browser_id].session_id = session_id;
+    pthread_mutex_unlock(&browser_list_mutex);
+    pthread_mutex_unlock(&browser_list[browser_id].send_mutex);
+    pthread_mutex_unlock(&session_mutex[session_id]);
+
+    arm_timer(browser_id, IDLE_TIMEOUT_MS);
 
     return browser_id;
 }
 
 /**
- * Handles the given browser by listening to it, processing the message received,
- * broadcasting the update to all browsers with the same session ID, and backing up
- * the session on the disk.
+ * Stops the timer of the given browser, frees its slot, and closes its socket.
+ * The timer is cancelled first so that it cannot shut down a reused socket,
+ * and the send lock is held so that no send is in flight when the socket closes.
+ * The slot's generation moves on, so messages still queued for this browser
+ * are never sent to the next browser in the slot.
+ *
+ * @param browser_id the browser ID
+ */
+void release_browser(int browser_id) {
+    pthread_mutex_lock(&timer_wheel_mutex);
+    timer_wheel_cancel(&browser_list[browser_id].timer);
+    pthread_mutex_unlock(&timer_wheel_mutex);
+
+    pthread_mutex_lock(&browser_list[browser_id].send_mutex);
+    pthread_mutex_lock(&browser_list_mutex);
+    browser_list[browser_id].in_use = false;
+    browser_list[browser_id].generation++;
+    browser_list[browser_id].session_id = -1;
+    pthread_mutex_unlock(&browser_list_mutex);
+
+    close(browser_list[browser_id].socket_fd);
+    pthread_mutex_unlock(&browser_list[browser_id].send_mutex);
+}
+
+/**
+ * Handles the given browser by listening to it and queueing the messages
+ * received for the workers. Messages over the browser's rate limit, or beyond
+ * what the server can queue, are answered with a busy response right away.
+ * Updates are numbered from 1 in the order they arrive, the same way the
+ * browser numbers them, so that every answer names the update it is for.
+ * Every message, heartbeats included, restarts the browser's idle timer; a
+ * browser that disconnects or times out is released.
  *
  * @param browser_socket_fd the socket file descriptor of the browser connected
  */
@@ -312,24 +598,39 @@ void browser_handler(int browser_socket_fd) {
     int browser_id;
 
     browser_id = register_browser(browser_socket_fd);
+    if (browser_id == -1) {
+        printf("Failed to register a browser.\n");
+        return;
+    }
 
     int socket_fd = browser_list[browser_id].socket_fd;
     int session_id = browser_list[browser_id].session_id;
+    unsigned int generation = browser_list[browser_id].generation;
 
     printf("Successfully accepted Browser #%d for Session #%d.\n", browser_id, session_id);
 
+    int seq = 0;
     while (true) {
         char message[BUFFER_LEN];
         char response[BUFFER_LEN];
 
-        receive_message(socket_fd, message);
+        if (receive_message(socket_fd, message) <= 0) {
+            release_browser(browser_id);
+            printf("Browser #%d disconnected.\n", browser_id);
+            return;
+        }
+
+        arm_timer(browser_id, IDLE_TIMEOUT_MS);
+        if (strcmp(message, HEARTBEAT_MESSAGE) == 0) {
+            continue;
+        }
+
+        uint64_t request_id = trace_new_request();
+        trace_record(TRACE_RECEIVE, TRACE_MARK, session_id, browser_id);
         printf("Received message from Browser #%d for Session #%d: %s\n", browser_id, session_id, message);
 
         if ((strcmp(message, "EXIT") == 0) || (strcmp(message, "exit") == 0)) {
-            close(socket_fd);
-            pthread_mutex_lock(&browser_list_mutex);
-            browser_list[browser_id].in_use = false;
-            pthread_mutex_unlock(&browser_list_mutex);
+            release_browser(browser_id);
             printf("Browser #%d exited.\n", browser_id);
             return;
         }
@@ -337,20 +638,43 @@ void browser_handler(int browser_socket_fd) {
         if (message[0] == '\0') {
             continue;
         }
+        seq++;
 
-        bool data_valid = process_message(session_id, message);
-        if (!data_valid) {
-            // TODO: For Part 3.1, add code here to send the error message to the browser.
+        if (!take_token(browser_id)) {
+            rejection_to_message(seq, RATE_LIMITED_MESSAGE, response);
+            trace_record(TRACE_SEND, TRACE_BEGIN, session_id, browser_id);
+            send_to_browser(browser_id, generation, session_id, response);
+            trace_record(TRACE_SEND, TRACE_END, session_id, browser_id);
             continue;
         }
 
-        session_to_str(session_id, response);
-        broadcast(session_id, response);
-
-        save_session(session_id);
+        update_t update;
+        update.browser_id = browser_id;
+        update.generation = generation;
+        update.seq = seq;
+        update.request_id = request_id;
+        strcpy(update.message, message);
+        if (!enqueue_update(session_id, &update)) {
+            rejection_to_message(seq, SERVER_BUSY_MESSAGE, response);
+            trace_record(TRACE_SEND, TRACE_BEGIN, session_id, browser_id);
+            send_to_browser(browser_id, generation, session_id, response);
+            trace_record(TRACE_SEND, TRACE_END, session_id, browser_id);
+        }
     }
 }
 
+/**
+ * Runs browser_handler() on its own thread.
+ *
+ * @param arg the socket file descriptor of the browser connected
+ * @return always NULL
+ */
+void *browser_thread(void *arg) {
+    browser_handler((int) (intptr_t) arg);
+    trace_thread_exit();
+    return NULL;
+}
+
 /**
  * Starts the server. Sets up the connection, keeps accepting new browsers,
  * and creates handlers for them.
@@ -361,6 +685,9 @@ void start_server(int port) {
     // Loads every session if there exists one on the disk.
     load_all_sessions();
 
+    // A browser that disappears must not kill the server with SIGPIPE.
+    signal(SIGPIPE, SIG_IGN);
+
     // Creates the socket.
     int server_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket_fd == 0) {
@@ -385,6 +712,34 @@ void start_server(int port) {
     }
     printf("The server is now listening on port %d.\n", port);
 
+    // Initializes the browser slots; a browser belongs to no session until it is registered.
+    for (int i = 0; i < NUM_BROWSER; ++i) {
+        browser_list[i].session_id = -1;
+        pthread_mutex_init(&browser_list[i].send_mutex, NULL);
+    }
+    for (int i = 0; i < NUM_SESSIONS; ++i) {
+        pthread_mutex_init(&session_mutex[i], NULL);
+    }
+
+    // Starts the timer thread that drives the connection timeouts.
+    timer_wheel_init(&timer_wheel);
+    pthread_t timer;
+    if (pthread_create(&timer, NULL, timer_thread, NULL) != 0) {
+        perror("Timer creation failed");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(timer);
+
+    // Starts the worker threads that serve the session queues.
+    for (int i = 0; i < NUM_WORKERS; ++i) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, worker_thread, NULL) != 0) {
+            perror("Worker creation failed");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(worker);
+    }
+
     // Main loop to accept new browsers and creates handlers for them.
     while (true) {
         struct sockaddr_in browser_address;
@@ -395,9 +750,18 @@ void start_server(int port) {
             continue;
         }
 
+        // Bounds how long a send to this browser may block.
+        struct timeval send_timeout = {SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000};
+        setsockopt(browser_socket_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
         // Starts the handler thread for the new browser.
-        // TODO: For Part 2.1, creat a thread to run browser_handler() here.
-        browser_handler(browser_socket_fd);
+        pthread_t handler;
+        if (pthread_create(&handler, NULL, browser_thread, (void *) (intptr_t) browser_socket_fd) != 0) {
+            perror("Handler creation failed");
+            close(browser_socket_fd);
+            continue;
+        }
+        pthread_detach(handler);
     }
 
     // Closes the socket.
@@ -413,12 +777,23 @@ void start_server(int port) {
  */
 int main(int argc, char *argv[]) {
     int port = DEFAULT_PORT;
+    char *trace_path = NULL;
 
     if (argc == 1) {
     } else if ((argc == 3)
                && ((strcmp(argv[1], "--port") == 0) || (strcmp(argv[1], "-p") == 0))) {
         port = strtol(argv[2], NULL, 10);
 
+    } else if ((argc == 3)
+               && ((strcmp(argv[1], "--trace") == 0) || (strcmp(argv[1], "-t") == 0))) {
+        trace_path = argv[2];
+
+    } else if ((argc == 5)
+               && ((strcmp(argv[1], "--port") == 0) || (strcmp(argv[1], "-p") == 0))
+               && ((strcmp(argv[3], "--trace") == 0) || (strcmp(argv[3], "-t") == 0))) {
+        port = strtol(argv[2], NULL, 10);
+        trace_path = argv[4];
+
     } else {
         puts("Invalid arguments.");
         exit(EXIT_FAILURE);
@@ -429,6 +804,15 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // Starts tracing if a trace file is given.
+    if (trace_path != NULL) {
+        if (!trace_start(trace_path)) {
+            perror("Trace start failed");
+            exit(EXIT_FAILURE);
+        }
+        printf("Tracing to %s.\n", trace_path);
+    }
+
     start_server(port);
 
     exit(EXIT_SUCCESS);
@@ -0,0 +1,288 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "session_util.h"
+#include "net_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+// Returns the index of the variable that the given token names, or -1 if it names none.
+static int variable_index(const char token[]);
+
+// Reads the value of the given token, which is either a number or an assigned variable.
+static bool read_operand(const session_t *session, const char token[], double *value);
+
+/**
+ * Returns the string format of the given session.
+ * There will be always 9 digits in the output string.
+ *
+ * @param session the session
+ * @param result an array to store the string format of the given session;
+ *               any data already in the array will be erased
+ */
+void session_to_str(const session_t *session, char result[]) {
+    memset(result, 0, BUFFER_LEN);
+
+    for (int i = 0; i < NUM_VARIABLES; ++i) {
+        if (session->variables[i]) {
+            char line[32];
+
+            if (fabs(session->values[i]) < 1000) {
+                snprintf(line, sizeof(line), "%c = %.6f\n", 'a' + i, session->values[i]);
+            } else {
+                snprintf(line, sizeof(line), "%c = %.8e\n", 'a' + i, session->values[i]);
+            }
+
+            strcat(result, line);
+        }
+    }
+}
+
+/**
+ * Determines if the given string represents a number.
+ *
+ * @param str the string to determine if it represents a number
+ * @return a boolean that determines if the given string represents a number
+ */
+bool is_str_numeric(const char str[]) {
+    if (str == NULL) {
+        return false;
+    }
+
+    if (!(isdigit(str[0]) || (str[0] == '-') || (str[0] == '.'))) {
+        return false;
+    }
+
+    int i = 1;
+    while (str[i] != '\0') {
+        if (!(isdigit(str[i]) || str[i] == '.')) {
+            return false;
+        }
+        i++;
+    }
+
+    return true;
+}
+
+/**
+ * Returns the index of the variable that the given token names.
+ *
+ * @param token the token
+ * @return the index of the variable, or -1 if the token is not a single letter from a to z
+ */
+static int variable_index(const char token[]) {
+    if (token == NULL || token[0] < 'a' || token[0] > 'z' || token[1] != '\0') {
+        return -1;
+    }
+
+    return token[0] - 'a';
+}
+
+/**
+ * Reads the value of the given token, which is either a number or a variable
+ * that has been assigned with some value.
+ *
+ * @param session the session
+ * @param token the token
+ * @param value the value of the token
+ * @return a boolean that determines if the token is a valid operand
+ */
+static bool read_operand(const session_t *session, const char token[], double *value) {
+    if (is_str_numeric(token)) {
+        *value = strtod(token, NULL);
+        return true;
+    }
+
+    int idx = variable_index(token);
+    if (idx == -1 || !session->variables[idx]) {
+        return false;
+    }
+
+    *value = session->values[idx];
+    return true;
+}
+
+/**
+ * Process the given message and update the given session if it is valid.
+ * A valid message is "x = y" or "x = y op z", where x is a variable, y and z are
+ * numbers or assigned variables, and op is one of +, -, * and /.
+ *
+ * @param session the session to update
+ * @param message the message to be processed
+ * @return a boolean that determines if the given message is valid
+ */
+bool process_message(session_t *session, const char message[]) {
+    char *token;
+    char *save_ptr;
+    int result_idx;
+    double first_value;
+    char symbol;
+    double second_value;
+
+    // Makes a copy of the string since strtok_r() will modify the string that it is processing.
+    char data[BUFFER_LEN];
+    strncpy(data, message, BUFFER_LEN - 1);
+    data[BUFFER_LEN - 1] = '\0';
+
+    // Processes the result variable.
+    token = strtok_r(data, " ", &save_ptr);
+    result_idx = variable_index(token);
+    if (result_idx == -1) {
+        return false;
+    }
+
+    // Processes "=".
+    token = strtok_r(NULL, " ", &save_ptr);
+    if (token == NULL || strcmp(token, "=") != 0) {
+        return false;
+    }
+
+    // Processes the first variable/value.
+    token = strtok_r(NULL, " ", &save_ptr);
+    if (!read_operand(session, token, &first_value)) {
+        return false;
+    }
+
+    // Processes the operation symbol.
+    token = strtok_r(NULL, " ", &save_ptr);
+    if (token == NULL) {
+        session->variables[result_idx] = true;
+        session->values[result_idx] = first_value;
+        return true;
+    }
+    if (strlen(token) != 1 || strchr("+-*/", token[0]) == NULL) {
+        return false;
+    }
+    symbol = token[0];
+
+    // Processes the second variable/value.
+    token = strtok_r(NULL, " ", &save_ptr);
+    if (!read_operand(session, token, &second_value)) {
+        return false;
+    }
+
+    // No data should be left over thereafter.
+    token = strtok_r(NULL, " ", &save_ptr);
+    if (token != NULL) {
+        return false;
+    }
+
+    session->variables[result_idx] = true;
+
+    if (symbol == '+') {
+        session->values[result_idx] = first_value + second_value;
+    } else if (symbol == '-') {
+        session->values[result_idx] = first_value - second_value;
+    } else if (symbol == '*') {
+        session->values[result_idx] = first_value * second_value;
+    } else if (symbol == '/') {
+        session->values[result_idx] = first_value / second_value;
+    }
+
+    return true;
+}
+
+/**
+ * Returns the message that carries the exact state of the given session. The
+ * first line is the header and the acknowledged sequence number; every assigned
+ * variable follows on its own line with enough digits to restore it exactly.
+ *
+ * @param session the session
+ * @param ack the sequence number of the recipient's own update that this state
+ *            includes, or 0 if it acknowledges none
+ * @param result an array to store the message;
+ *               any data already in the array will be erased
+ */
+void session_to_message(const session_t *session, int ack, char result[]) {
+    memset(result, 0, BUFFER_LEN);
+    sprintf(result, "%s %d\n", STATE_HEADER, ack);
+
+    for (int i = 0; i < NUM_VARIABLES; ++i) {
+        if (session->variables[i]) {
+            char line[40];
+            snprintf(line, sizeof(line), "%c = %.17g\n", 'a' + i, session->values[i]);
+            strcat(result, line);
+        }
+    }
+}
+
+/**
+ * Parses a message made by session_to_message().
+ *
+ * @param message the message
+ * @param ack the acknowledged sequence number
+ * @param session the session to store the result;
+ *                any data already in the session will be erased
+ * @return a boolean that determines if the message carries a session state
+ */
+bool message_to_session(const char message[], int *ack, session_t *session) {
+    size_t header_len = strlen(STATE_HEADER);
+    if (strncmp(message, STATE_HEADER, header_len) != 0 || sscanf(message + header_len, "%d", ack) != 1) {
+        return false;
+    }
+
+    memset(session, 0, sizeof(session_t));
+
+    const char *line = strchr(message, '\n');
+    while (line != NULL && *(++line) != '\0') {
+        char name;
+        double value;
+
+        if (sscanf(line, "%c = %lf", &name, &value) == 2 && name >= 'a' && name <= 'z') {
+            session->variables[name - 'a'] = true;
+            session->values[name - 'a'] = value;
+        }
+
+        line = strchr(line, '\n');
+    }
+
+    return true;
+}
+
+/**
+ * Returns the message that rejects the update with the given sequence number.
+ *
+ * @param seq the sequence number of the rejected update
+ * @param reason the reason shown to the user
+ * @param result an array to store the message;
+ *               any data already in the array will be erased
+ */
+void rejection_to_message(int seq, const char reason[], char result[]) {
+    memset(result, 0, BUFFER_LEN);
+    snprintf(result, BUFFER_LEN, "%s %d\n%s", REJECT_HEADER, seq, reason);
+}
+
+/**
+ * Parses a message made by rejection_to_message().
+ *
+ * @param message the message
+ * @param seq the sequence number of the rejected update
+ * @param reason an array to store the reason
+ * @return a boolean that determines if the message is a rejection
+ */
+bool message_to_rejection(const char message[], int *seq, char reason[]) {
+    size_t header_len = strlen(REJECT_HEADER);
+    if (strncmp(message, REJECT_HEADER, header_len) != 0 || sscanf(message + header_len, "%d", seq) != 1) {
+        return false;
+    }
+
+    const char *line = strchr(message, '\n');
+    strcpy(reason, line != NULL ? line + 1 : "");
+    return true;
+}
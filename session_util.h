@@ -0,0 +1,52 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#ifndef PROJECT_SESSION_H
+#define PROJECT_SESSION_H
+
+#include <stdbool.h>
+
+#define NUM_VARIABLES 26
+#define STATE_HEADER "STATE"
+#define REJECT_HEADER "REJECT"
+
+typedef struct session_struct {
+    bool in_use;
+    bool variables[NUM_VARIABLES];
+    double values[NUM_VARIABLES];
+} session_t;
+
+// Returns the string format of the given session.
+// There will be always 9 digits in the output string.
+void session_to_str(const session_t *session, char result[]);
+
+// Determines if the given string represents a number.
+bool is_str_numeric(const char str[]);
+
+// Process the given message and update the given session if it is valid.
+bool process_message(session_t *session, const char message[]);
+
+// Returns the message that carries the exact state of the given session
+// and acknowledges the recipient's own update with the given sequence number.
+void session_to_message(const session_t *session, int ack, char result[]);
+
+// Parses a message made by session_to_message().
+bool message_to_session(const char message[], int *ack, session_t *session);
+
+// Returns the message that rejects the update with the given sequence number.
+void rejection_to_message(int seq, const char reason[], char result[]);
+
+// Parses a message made by rejection_to_message().
+bool message_to_rejection(const char message[], int *seq, char reason[]);
+
+#endif //PROJECT_SESSION_H
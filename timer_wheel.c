@@ -0,0 +1,156 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#include "timer_wheel.h"
+
+#include <stddef.h>
+
+// Links the given timer into the slot that matches its expiry.
+static void place_timer(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/**
+ * Links the given timer into the slot that matches its expiry. A timer that
+ * expires within 64 ticks goes to level 0, within 64^2 ticks to level 1, etc.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer to place
+ */
+static void place_timer(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    uint64_t delta = timer->expires - wheel->now;
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << ((level + 1) * TIMER_WHEEL_BITS))) {
+        level++;
+    }
+
+    int slot = (int) ((timer->expires >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1));
+    wheel_timer_t *head = &wheel->slots[level][slot];
+
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/**
+ * Initializes the given timer wheel at tick 0.
+ *
+ * @param wheel the timer wheel
+ */
+void timer_wheel_init(timer_wheel_t *wheel) {
+    wheel->now = 0;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+        }
+    }
+}
+
+/**
+ * Initializes the given timer with the callback to run when it expires.
+ *
+ * @param timer the timer
+ * @param callback the function to run when the timer expires
+ * @param arg the argument passed to the callback
+ */
+void timer_init(wheel_timer_t *timer, void (*callback)(void *arg), void *arg) {
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/**
+ * Determines if the given timer is pending.
+ *
+ * @param timer the timer
+ * @return a boolean that determines if the timer is pending
+ */
+bool timer_pending(const wheel_timer_t *timer) {
+    return timer->next != NULL;
+}
+
+/**
+ * Adds the given timer to expire after the given number of ticks.
+ * The timer must not be pending.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer to add
+ * @param ticks the number of ticks until the timer expires; at least 1
+ */
+void timer_wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t ticks) {
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > TIMER_WHEEL_MAX_TICKS) {
+        ticks = TIMER_WHEEL_MAX_TICKS;
+    }
+
+    timer->expires = wheel->now + ticks;
+    place_timer(wheel, timer);
+}
+
+/**
+ * Cancels the given timer if it is pending.
+ *
+ * @param timer the timer to cancel
+ */
+void timer_wheel_cancel(wheel_timer_t *timer) {
+    if (!timer_pending(timer)) {
+        return;
+    }
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/**
+ * Advances the wheel by one tick and runs the callbacks of the expired timers.
+ * Whenever a lower level wraps around, the matching slot of the level above is
+ * moved down, starting from the highest level. Callbacks may add or cancel other
+ * timers but must not cancel timers that expire in the same tick.
+ *
+ * @param wheel the timer wheel
+ */
+void timer_wheel_advance(timer_wheel_t *wheel) {
+    wheel->now++;
+
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+        if ((wheel->now & ((1ull << (level * TIMER_WHEEL_BITS)) - 1)) != 0) {
+            continue;
+        }
+
+        int slot = (int) ((wheel->now >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1));
+        wheel_timer_t *head = &wheel->slots[level][slot];
+        wheel_timer_t *timer = head->next;
+        head->prev = head;
+        head->next = head;
+
+        while (timer != head) {
+            wheel_timer_t *next = timer->next;
+            place_timer(wheel, timer);
+            timer = next;
+        }
+    }
+
+    wheel_timer_t *head = &wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)];
+    while (head->next != head) {
+        wheel_timer_t *timer = head->next;
+        timer_wheel_cancel(timer);
+        timer->callback(timer->arg);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#ifndef PROJECT_TIMER_WHEEL_H
+#define PROJECT_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MAX_TICKS ((1ull << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)
+
+// A timer that is embedded in the object it belongs to,
+// so adding and cancelling it never allocates.
+typedef struct wheel_timer_struct {
+    struct wheel_timer_struct *prev;
+    struct wheel_timer_struct *next;
+    uint64_t expires;
+    void (*callback)(void *arg);
+    void *arg;
+} wheel_timer_t;
+
+// A hierarchical timer wheel.
+// Each slot is the head of a circular list of timers.
+typedef struct timer_wheel_struct {
+    uint64_t now;
+    wheel_timer_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+// Initializes the given timer wheel at tick 0.
+void timer_wheel_init(timer_wheel_t *wheel);
+
+// Initializes the given timer with the callback to run when it expires.
+void timer_init(wheel_timer_t *timer, void (*callback)(void *arg), void *arg);
+
+// Determines if the given timer is pending.
+bool timer_pending(const wheel_timer_t *timer);
+
+// Adds the given timer to expire after the given number of ticks.
+void timer_wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t ticks);
+
+// Cancels the given timer if it is pending.
+void timer_wheel_cancel(wheel_timer_t *timer);
+
+// Advances the wheel by one tick and runs the callbacks of the expired timers.
+void timer_wheel_advance(timer_wheel_t *wheel);
+
+#endif //PROJECT_TIMER_WHEEL_H
@@ -0,0 +1,271 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#define RING_FREE 0
+#define RING_ACTIVE 1
+#define RING_RETIRED 2
+
+// A single-producer, single-consumer ring of trace records.
+// The owning thread advances head; the flusher advances tail.
+typedef struct trace_ring_struct {
+    atomic_int state;
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t tail;
+    atomic_uint_fast64_t dropped;
+    trace_record_t records[TRACE_RING_LEN];
+} trace_ring_t;
+
+const char *trace_stage_names[NUM_TRACE_STAGES] = {
+        "receive_message",
+        "queue",
+        "process_message",
+        "session_to_message",
+        "send_message",
+        "save_session"
+};
+
+static bool trace_on = false;                               // Determines if tracing is on/off.
+static FILE *trace_file;                                    // The file that the rings are flushed to.
+static trace_ring_t *rings;                                 // The rings of all tracing threads.
+static sem_t flush_sem;                                     // Wakes the flusher early when a ring is half full.
+static atomic_uint_fast64_t next_request_id = 1;            // The ID of the next request; 0 means none.
+static _Thread_local trace_ring_t *thread_ring = NULL;      // The ring of the calling thread.
+static _Thread_local uint64_t thread_request_id = 0;        // The current request of the calling thread.
+
+// Returns the ring of the calling thread, claiming a free one if needed.
+static trace_ring_t *get_thread_ring();
+
+// Writes the pending records of the given ring to the trace file.
+static void drain_ring(trace_ring_t *ring);
+
+// Periodically drains every ring to the trace file.
+static void *flusher_thread(void *arg);
+
+/**
+ * Returns the ring of the calling thread, claiming a free one if needed.
+ *
+ * @return the ring, or NULL if every ring is taken
+ */
+static trace_ring_t *get_thread_ring() {
+    if (thread_ring != NULL) {
+        return thread_ring;
+    }
+
+    for (int i = 0; i < TRACE_MAX_THREADS; ++i) {
+        int expected = RING_FREE;
+        if (atomic_compare_exchange_strong(&rings[i].state, &expected, RING_ACTIVE)) {
+            thread_ring = &rings[i];
+            return thread_ring;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Writes the pending records of the given ring to the trace file.
+ * Only called from the flusher thread.
+ *
+ * @param ring the ring to drain
+ */
+static void drain_ring(trace_ring_t *ring) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head) {
+        uint64_t start = tail & (TRACE_RING_LEN - 1);
+        uint64_t count = head - tail;
+        if (start + count > TRACE_RING_LEN) {
+            count = TRACE_RING_LEN - start;
+        }
+
+        fwrite(&ring->records[start], sizeof(trace_record_t), count, trace_file);
+        tail += count;
+    }
+
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+/**
+ * Periodically drains every ring to the trace file, and right away when a ring
+ * becomes half full. A retired ring is drained one last time and then made free
+ * for another thread.
+ *
+ * @param arg unused
+ * @return never returns
+ */
+static void *flusher_thread(void *arg) {
+    (void) arg;
+    uint64_t reported_dropped = 0;
+
+    while (true) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TRACE_FLUSH_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        sem_timedwait(&flush_sem, &deadline);
+
+        uint64_t dropped = 0;
+        for (int i = 0; i < TRACE_MAX_THREADS; ++i) {
+            trace_ring_t *ring = &rings[i];
+            int state = atomic_load_explicit(&ring->state, memory_order_acquire);
+            if (state == RING_FREE) {
+                continue;
+            }
+
+            drain_ring(ring);
+            dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+            if (state == RING_RETIRED) {
+                atomic_store_explicit(&ring->state, RING_FREE, memory_order_release);
+            }
+        }
+        fflush(trace_file);
+
+        if (dropped > reported_dropped) {
+            fprintf(stderr, "Trace ring overflow: %llu records dropped so far.\n", (unsigned long long) dropped);
+            reported_dropped = dropped;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts tracing to the given file. Tracing stays off unless this is called,
+ * and must be started before any other thread records events.
+ *
+ * @param path the path of the trace file
+ * @return a boolean that determines if tracing was started
+ */
+bool trace_start(const char path[]) {
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL) {
+        return false;
+    }
+
+    rings = calloc(TRACE_MAX_THREADS, sizeof(trace_ring_t));
+    if (rings == NULL || sem_init(&flush_sem, 0, 0) != 0) {
+        free(rings);
+        fclose(trace_file);
+        return false;
+    }
+
+    uint32_t magic = TRACE_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, trace_file);
+
+    pthread_t flusher;
+    if (pthread_create(&flusher, NULL, flusher_thread, NULL) != 0) {
+        free(rings);
+        fclose(trace_file);
+        return false;
+    }
+    pthread_detach(flusher);
+
+    trace_on = true;
+    return true;
+}
+
+/**
+ * Starts a new request and makes it the current request of the calling thread.
+ *
+ * @return the ID of the new request, or 0 if tracing is off
+ */
+uint64_t trace_new_request() {
+    if (!trace_on) {
+        return 0;
+    }
+
+    thread_request_id = atomic_fetch_add_explicit(&next_request_id, 1, memory_order_relaxed);
+    return thread_request_id;
+}
+
+/**
+ * Makes the given request the current request of the calling thread.
+ *
+ * @param request_id the request ID
+ */
+void trace_set_request(uint64_t request_id) {
+    thread_request_id = request_id;
+}
+
+/**
+ * Records an event of the current request of the calling thread. Never blocks;
+ * the record is dropped if the thread's ring is full. The ring that reaches
+ * half full wakes the flusher, so a broadcast to every browser does not have
+ * to wait for the next interval.
+ *
+ * @param stage the stage of the request
+ * @param event whether the stage begins, ends, or is a single point in time
+ * @param session_id the session ID
+ * @param browser_id the browser ID
+ */
+void trace_record(trace_stage_t stage, trace_event_t event, int session_id, int browser_id) {
+    if (!trace_on || thread_request_id == 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    trace_ring_t *ring = get_thread_ring();
+    if (ring == NULL) {
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == TRACE_RING_LEN) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    trace_record_t *record = &ring->records[head & (TRACE_RING_LEN - 1)];
+    record->request_id = thread_request_id;
+    record->timestamp = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+    record->stage = stage;
+    record->event = event;
+    record->ring_id = (uint32_t) (ring - rings);
+    record->session_id = session_id;
+    record->browser_id = browser_id;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if (head + 1 - tail == TRACE_RING_LEN / 2) {
+        sem_post(&flush_sem);
+    }
+}
+
+/**
+ * Releases the ring of the calling thread; call before the thread exits.
+ * The flusher drains the ring one last time before another thread can claim it.
+ */
+void trace_thread_exit() {
+    if (thread_ring != NULL) {
+        atomic_store_explicit(&thread_ring->state, RING_RETIRED, memory_order_release);
+        thread_ring = NULL;
+    }
+    thread_request_id = 0;
+}
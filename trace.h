@@ -0,0 +1,71 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#ifndef PROJECT_TRACE_H
+#define PROJECT_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x31525457u         // "WTR1" in little endian.
+#define TRACE_RING_LEN 8192             // Records per thread ring; must be a power of two.
+#define TRACE_MAX_THREADS 256           // Maximum number of threads that trace at the same time.
+#define TRACE_FLUSH_INTERVAL_MS 100     // How often the rings are flushed to the trace file at most.
+
+typedef enum trace_stage_enum {
+    TRACE_RECEIVE,
+    TRACE_QUEUE,
+    TRACE_PROCESS,
+    TRACE_SESSION_TO_MESSAGE,
+    TRACE_SEND,
+    TRACE_SAVE,
+    NUM_TRACE_STAGES
+} trace_stage_t;
+
+typedef enum trace_event_enum {
+    TRACE_BEGIN,
+    TRACE_END,
+    TRACE_MARK
+} trace_event_t;
+
+// One record in the trace file, which starts with a single uint32_t TRACE_MAGIC.
+typedef struct trace_record_struct {
+    uint64_t request_id;
+    uint64_t timestamp;     // Nanoseconds on CLOCK_MONOTONIC.
+    uint16_t stage;
+    uint16_t event;
+    uint32_t ring_id;
+    int32_t session_id;
+    int32_t browser_id;
+} trace_record_t;
+
+// The names of the trace stages.
+extern const char *trace_stage_names[NUM_TRACE_STAGES];
+
+// Starts tracing to the given file.
+// Tracing stays off unless this is called.
+bool trace_start(const char path[]);
+
+// Starts a new request and makes it the current request of the calling thread.
+uint64_t trace_new_request();
+
+// Makes the given request the current request of the calling thread.
+void trace_set_request(uint64_t request_id);
+
+// Records an event of the current request of the calling thread.
+void trace_record(trace_stage_t stage, trace_event_t event, int session_id, int browser_id);
+
+// Releases the ring of the calling thread; call before the thread exits.
+void trace_thread_exit();
+
+#endif //PROJECT_TRACE_H
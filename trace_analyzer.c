@@ -0,0 +1,369 @@
+/*
+ ***************************************************************************
+ * Clarkson University                                                     *
+ * CS 444/544: Operating Systems, Spring 2022                              *
+ * Project: Prototyping a Web Server/Browser                               *
+ * Created by Daqing Hou, dhou@clarkson.edu                                *
+ *            Xinchao Song, xisong@clarkson.edu                            *
+ * March 30, 2022                                                          *
+ * Copyright © 2022 CS 444/544 Instructor Team. All rights reserved.       *
+ * Unauthorized use is strictly prohibited.                                *
+ ***************************************************************************
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NUM_SLOWEST_SHOWN 10
+#define OTHER_STAGE NUM_TRACE_STAGES    // Time between the traced stages, e.g. admission control.
+
+typedef struct timeline_struct {
+    uint64_t request_id;
+    int session_id;
+    int browser_id;
+    uint64_t start;
+    uint64_t total;
+    uint64_t stages[NUM_TRACE_STAGES + 1];
+    int num_sends;
+} timeline_t;
+
+// Reads every record from the given trace file.
+trace_record_t *read_trace(const char path[], size_t *num_records);
+
+// Orders records by request ID, then by timestamp.
+int compare_records(const void *a, const void *b);
+
+// Orders timelines from the slowest to the fastest.
+int compare_timelines(const void *a, const void *b);
+
+// Rebuilds one timeline per completed request from the sorted records.
+// Counts the requests that are incomplete or were never queued.
+timeline_t *build_timelines(const trace_record_t records[], size_t num_records, size_t *num_timelines,
+                            size_t *num_incomplete, size_t *num_unqueued);
+
+// Returns the stage that took the most time in the given timeline.
+int dominant_stage(const timeline_t *timeline);
+
+// Returns the name of the given stage.
+const char *stage_name(int stage);
+
+// Prints the latency percentiles and which stages dominated the slow requests.
+void report(const timeline_t timelines[], size_t num_timelines, size_t num_incomplete, size_t num_unqueued);
+
+/**
+ * Reads every record from the given trace file.
+ *
+ * @param path the path of the trace file
+ * @param num_records the number of records read
+ * @return an array of records that the caller frees, or NULL on error
+ */
+trace_record_t *read_trace(const char path[], size_t *num_records) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Trace open failed");
+        return NULL;
+    }
+
+    uint32_t magic;
+    if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != TRACE_MAGIC) {
+        puts("Not a trace file.");
+        fclose(file);
+        return NULL;
+    }
+
+    size_t capacity = 4096;
+    size_t count = 0;
+    trace_record_t *records = malloc(capacity * sizeof(trace_record_t));
+
+    while (records != NULL) {
+        if (count == capacity) {
+            capacity *= 2;
+            trace_record_t *grown = realloc(records, capacity * sizeof(trace_record_t));
+            if (grown == NULL) {
+                free(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
+        }
+
+        size_t read = fread(&records[count], sizeof(trace_record_t), capacity - count, file);
+        if (read == 0) {
+            break;
+        }
+        count += read;
+    }
+
+    fclose(file);
+    *num_records = count;
+    return records;
+}
+
+/**
+ * Orders records by request ID, then by timestamp.
+ *
+ * @param a the first record
+ * @param b the second record
+ * @return a negative, zero, or positive number as in qsort()
+ */
+int compare_records(const void *a, const void *b) {
+    const trace_record_t *x = a;
+    const trace_record_t *y = b;
+
+    if (x->request_id != y->request_id) {
+        return x->request_id < y->request_id ? -1 : 1;
+    }
+    if (x->timestamp != y->timestamp) {
+        return x->timestamp < y->timestamp ? -1 : 1;
+    }
+    return (int) x->event - (int) y->event;
+}
+
+/**
+ * Orders timelines from the slowest to the fastest.
+ *
+ * @param a the first timeline
+ * @param b the second timeline
+ * @return a negative, zero, or positive number as in qsort()
+ */
+int compare_timelines(const void *a, const void *b) {
+    const timeline_t *x = a;
+    const timeline_t *y = b;
+
+    if (x->total != y->total) {
+        return x->total > y->total ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Rebuilds one timeline per completed request from the sorted records. A request
+ * is completed once it has left the queue and every stage it began has ended.
+ * A request that was never queued, e.g. one rejected by the rate limit, has no
+ * timeline. A queued request with a missing record is incomplete; this happens
+ * when a ring overflowed or the request was still in flight. The time not
+ * covered by any stage is counted as "other".
+ *
+ * @param records the records sorted by compare_records()
+ * @param num_records the number of records
+ * @param num_timelines the number of timelines built
+ * @param num_incomplete the number of incomplete requests
+ * @param num_unqueued the number of requests that were never queued
+ * @return an array of timelines that the caller frees
+ */
+timeline_t *build_timelines(const trace_record_t records[], size_t num_records, size_t *num_timelines,
+                            size_t *num_incomplete, size_t *num_unqueued) {
+    timeline_t *timelines = calloc(num_records > 0 ? num_records : 1, sizeof(timeline_t));
+    size_t count = 0;
+
+    *num_incomplete = 0;
+    *num_unqueued = 0;
+
+    size_t i = 0;
+    while (i < num_records) {
+        timeline_t timeline;
+        uint64_t begins[NUM_TRACE_STAGES] = {0};
+        uint64_t end = records[i].timestamp;
+        bool queued = false;
+        bool dequeued = false;
+        bool complete = true;
+
+        memset(&timeline, 0, sizeof(timeline));
+        timeline.request_id = records[i].request_id;
+        timeline.session_id = records[i].session_id;
+        timeline.browser_id = records[i].browser_id;
+        timeline.start = records[i].timestamp;
+
+        for (; i < num_records && records[i].request_id == timeline.request_id; ++i) {
+            const trace_record_t *record = &records[i];
+            if (record->stage >= NUM_TRACE_STAGES) {
+                continue;
+            }
+
+            if (record->stage == TRACE_QUEUE) {
+                queued = true;
+            }
+
+            if (record->event == TRACE_BEGIN) {
+                if (begins[record->stage] != 0) {
+                    complete = false;
+                }
+                begins[record->stage] = record->timestamp;
+            } else if (record->event == TRACE_END && begins[record->stage] == 0) {
+                complete = false;
+            } else if (record->event == TRACE_END) {
+                timeline.stages[record->stage] += record->timestamp - begins[record->stage];
+                begins[record->stage] = 0;
+
+                if (record->stage == TRACE_QUEUE) {
+                    dequeued = true;
+                } else if (record->stage == TRACE_SEND) {
+                    timeline.num_sends++;
+                }
+            }
+
+            end = record->timestamp;
+        }
+
+        for (int stage = 0; stage < NUM_TRACE_STAGES; ++stage) {
+            if (begins[stage] != 0) {
+                complete = false;
+            }
+        }
+
+        if (!queued) {
+            (*num_unqueued)++;
+            continue;
+        }
+        if (!dequeued || !complete) {
+            (*num_incomplete)++;
+            continue;
+        }
+
+        timeline.total = end - timeline.start;
+        uint64_t covered = 0;
+        for (int stage = 0; stage < NUM_TRACE_STAGES; ++stage) {
+            covered += timeline.stages[stage];
+        }
+        timeline.stages[OTHER_STAGE] = timeline.total > covered ? timeline.total - covered : 0;
+
+        timelines[count++] = timeline;
+    }
+
+    *num_timelines = count;
+    return timelines;
+}
+
+/**
+ * Returns the stage that took the most time in the given timeline.
+ *
+ * @param timeline the timeline
+ * @return the stage, or OTHER_STAGE for the time between stages
+ */
+int dominant_stage(const timeline_t *timeline) {
+    int dominant = 0;
+
+    for (int stage = 1; stage <= OTHER_STAGE; ++stage) {
+        if (timeline->stages[stage] > timeline->stages[dominant]) {
+            dominant = stage;
+        }
+    }
+
+    return dominant;
+}
+
+/**
+ * Returns the name of the given stage.
+ *
+ * @param stage the stage, or OTHER_STAGE
+ * @return the name of the stage
+ */
+const char *stage_name(int stage) {
+    return stage == OTHER_STAGE ? "other" : trace_stage_names[stage];
+}
+
+/**
+ * Prints the latency percentiles, the stages that dominated the slowest 1% of the
+ * requests, and the timelines of the slowest requests.
+ *
+ * @param timelines the timelines sorted by compare_timelines()
+ * @param num_timelines the number of timelines
+ * @param num_incomplete the number of incomplete requests
+ * @param num_unqueued the number of requests that were never queued
+ */
+void report(const timeline_t timelines[], size_t num_timelines, size_t num_incomplete, size_t num_unqueued) {
+    printf("Requests: %zu\n", num_timelines);
+    printf("Incomplete: %zu (records dropped or still in flight)\n", num_incomplete);
+    printf("Not queued: %zu (rejected, empty, or EXIT)\n", num_unqueued);
+    if (num_timelines == 0) {
+        return;
+    }
+
+    const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+        size_t rank = (size_t) ((100.0 - percentiles[i]) / 100.0 * (double) num_timelines);
+        if (rank >= num_timelines) {
+            rank = num_timelines - 1;
+        }
+        printf("p%-5g %12.3f us\n", percentiles[i], (double) timelines[rank].total / 1e3);
+    }
+    printf("max    %12.3f us\n", (double) timelines[0].total / 1e3);
+
+    size_t num_slow = num_timelines / 100;
+    if (num_slow == 0) {
+        num_slow = 1;
+    }
+
+    int dominated[NUM_TRACE_STAGES + 1] = {0};
+    uint64_t stage_totals[NUM_TRACE_STAGES + 1] = {0};
+    uint64_t slow_total = 0;
+    for (size_t i = 0; i < num_slow; ++i) {
+        dominated[dominant_stage(&timelines[i])]++;
+        for (int stage = 0; stage <= OTHER_STAGE; ++stage) {
+            stage_totals[stage] += timelines[i].stages[stage];
+        }
+        slow_total += timelines[i].total;
+    }
+
+    printf("\nSlowest %zu requests:\n", num_slow);
+    printf("%-18s %10s %10s %10s\n", "stage", "dominant", "mean us", "share");
+    for (int stage = TRACE_QUEUE; stage <= OTHER_STAGE; ++stage) {
+        printf("%-18s %10d %10.3f %9.1f%%\n", stage_name(stage), dominated[stage],
+               (double) stage_totals[stage] / (double) num_slow / 1e3,
+               slow_total > 0 ? 100.0 * (double) stage_totals[stage] / (double) slow_total : 0.0);
+    }
+
+    size_t num_shown = num_timelines < NUM_SLOWEST_SHOWN ? num_timelines : NUM_SLOWEST_SHOWN;
+    printf("\nSlowest %zu timelines (us):\n", num_shown);
+    for (size_t i = 0; i < num_shown; ++i) {
+        const timeline_t *timeline = &timelines[i];
+        printf("#%llu session %d browser %d total %.3f:",
+               (unsigned long long) timeline->request_id, timeline->session_id, timeline->browser_id,
+               (double) timeline->total / 1e3);
+        for (int stage = TRACE_QUEUE; stage <= OTHER_STAGE; ++stage) {
+            printf(" %s %.3f", stage_name(stage), (double) timeline->stages[stage] / 1e3);
+            if (stage == TRACE_SEND) {
+                printf(" (x%d)", timeline->num_sends);
+            }
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * The main function for the trace analyzer.
+ *
+ * @param argc the number of command-line arguments passed by the user
+ * @param argv the array that contains all the arguments
+ * @return exit code
+ */
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        puts("Usage: trace_analyzer <trace file>");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t num_records;
+    trace_record_t *records = read_trace(argv[1], &num_records);
+    if (records == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    qsort(records, num_records, sizeof(trace_record_t), compare_records);
+
+    size_t num_timelines;
+    size_t num_incomplete;
+    size_t num_unqueued;
+    timeline_t *timelines = build_timelines(records, num_records, &num_timelines, &num_incomplete, &num_unqueued);
+    qsort(timelines, num_timelines, sizeof(timeline_t), compare_timelines);
+
+    report(timelines, num_timelines, num_incomplete, num_unqueued);
+
+    free(timelines);
+    free(records);
+    exit(EXIT_SUCCESS);
+}